@@ -0,0 +1,160 @@
+#ifndef UTILS_DISPATCH_H
+#define UTILS_DISPATCH_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "instrument.h"
+#include "macros.h"
+
+#if UTILS_ARCH_X86
+#include <cpuid.h>
+#endif
+
+namespace utils {
+// instruction set levels a kernel can be compiled for, in increasing order
+enum class Isa : int { kScalar = 0, kAvx2, kAvx512, kNum };
+
+inline const char* GetIsaName(Isa isa) {
+  switch (isa) {
+    case Isa::kAvx2:
+      return "avx2";
+    case Isa::kAvx512:
+      return "avx512";
+    default:
+      return "scalar";
+  }
+}
+
+// features supported by both the cpu and the os
+struct CpuFeatures {
+  bool avx2 = false;
+  bool fma = false;
+  bool avx512f = false;
+  bool avx512bw = false;
+  bool avx512vl = false;
+  bool avx512dq = false;
+};
+
+inline CpuFeatures DetectCpuFeatures() {
+  CpuFeatures features;
+#if UTILS_ARCH_X86
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return features;
+  // the os has to save ymm / zmm state, see XCR0
+  if (!(ecx & bit_OSXSAVE)) return features;
+  unsigned int xcr0_lo, xcr0_hi;
+  asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  const bool ymm_enabled = (xcr0_lo & 0x6) == 0x6;
+  const bool zmm_enabled = (xcr0_lo & 0xe6) == 0xe6;
+  const bool fma = ecx & bit_FMA;
+
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return features;
+  features.avx2 = ymm_enabled && (ebx & bit_AVX2);
+  features.fma = ymm_enabled && fma;
+  features.avx512f = zmm_enabled && (ebx & bit_AVX512F);
+  features.avx512bw = zmm_enabled && (ebx & bit_AVX512BW);
+  features.avx512vl = zmm_enabled && (ebx & bit_AVX512VL);
+  features.avx512dq = zmm_enabled && (ebx & bit_AVX512DQ);
+#endif
+  return features;
+}
+
+// detected once, on first use
+inline const CpuFeatures& GetCpuFeatures() {
+  static const CpuFeatures features = DetectCpuFeatures();
+  return features;
+}
+
+// highest isa level of this machine, which can be lowered (never raised) by
+// setting UTILS_MAX_ISA to scalar, avx2 or avx512 in the environment
+inline Isa GetBestIsa() {
+  static const Isa best = [] {
+    const CpuFeatures& f = GetCpuFeatures();
+    Isa isa = Isa::kScalar;
+    if (f.avx2 && f.fma) isa = Isa::kAvx2;
+    if (isa == Isa::kAvx2 && f.avx512f && f.avx512bw && f.avx512vl &&
+        f.avx512dq) {
+      isa = Isa::kAvx512;
+    }
+
+    const char* cap = std::getenv("UTILS_MAX_ISA");
+    if (cap != nullptr) {
+      for (int i = 0; i < static_cast<int>(isa); i++) {
+        if (std::strcmp(cap, GetIsaName(static_cast<Isa>(i))) == 0) {
+          return static_cast<Isa>(i);
+        }
+      }
+    }
+    return isa;
+  }();
+  return best;
+}
+
+/* registry of the variants of one kernel, Func is the function type:
+ *    auto* fn = Dispatcher<void(float*, int)>(ScaleScalar)
+ *                   .Register(Isa::kAvx2, ScaleAvx2)
+ *                   .Select();
+ * keep the selected pointer in a function-local static so the choice is
+ * made once.
+ */
+template <typename Func>
+class Dispatcher {
+ public:
+  explicit Dispatcher(Func* scalar) { variants_[0] = scalar; }
+
+  Dispatcher& Register(Isa isa, Func* func) {
+    variants_[static_cast<int>(isa)] = func;
+    return *this;
+  }
+
+  // the registered variant of the highest isa this machine supports
+  Func* Select() const {
+    for (int i = static_cast<int>(GetBestIsa()); i > 0; i--) {
+      if (variants_[i] != nullptr) return variants_[i];
+    }
+    return variants_[0];
+  }
+
+ private:
+  Func* variants_[static_cast<int>(Isa::kNum)] = {};
+};
+}  // namespace utils
+
+/* usage of UTILS_DISPATCH_KERNEL:
+ * 1. write the kernel body as a __forceinline__ function impl, e.g. with
+ *    unroll_for loops the compiler can vectorize
+ * 2. at namespace scope, invoke
+ *    UTILS_DISPATCH_KERNEL(void, Scale, (float* x, int n), (x, n), ScaleImpl)
+ * this defines Scale_scalar, Scale_avx2 and Scale_avx512 (x86 only), each
+ * with impl inlined and compiled for its target, plus Scale itself, which
+ * picks the best variant on its first call and jumps straight to it after.
+ * Scale is timed under its own name when UTILS_ENABLE_INSTRUMENTATION is 1.
+ */
+#if UTILS_ARCH_X86
+#define UTILS_DISPATCH_KERNEL(ret, name, params, args, impl)                  \
+  inline ret name##_scalar params { return impl args; }                       \
+  UTILS_TARGET_AVX2 inline ret name##_avx2 params { return impl args; }       \
+  UTILS_TARGET_AVX512 inline ret name##_avx512 params { return impl args; }   \
+  inline ret name params {                                                    \
+    static ret(*const fn) params = ::utils::Dispatcher<ret params>(           \
+                                       name##_scalar)                         \
+                                       .Register(::utils::Isa::kAvx2,         \
+                                                 name##_avx2)                 \
+                                       .Register(::utils::Isa::kAvx512,       \
+                                                 name##_avx512)               \
+                                       .Select();                             \
+    UTILS_PROFILE_SCOPE(#name);                                               \
+    return fn args;                                                           \
+  }
+#else
+#define UTILS_DISPATCH_KERNEL(ret, name, params, args, impl) \
+  inline ret name##_scalar params { return impl args; }      \
+  inline ret name params {                                   \
+    UTILS_PROFILE_SCOPE(#name);                              \
+    return name##_scalar args;                               \
+  }
+#endif
+
+#endif  // UTILS_DISPATCH_H
@@ -0,0 +1,252 @@
+#ifndef UTILS_GEMM_H
+#define UTILS_GEMM_H
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "math_utils.h"
+#include "naive_array.h"
+#include "unroller.h"
+
+namespace utils {
+namespace gemm_detail {
+// upper bounds of the cache blocks: a KC x NR sliver of B stays in L1,
+// an MC x KC block of A in L2 and a KC x NC panel of B in L3
+constexpr int kMaxMC = 144;
+constexpr int kMaxKC = 256;
+constexpr int kMaxNC = 4080;
+
+// split extent into the fewest blocks no larger than max_block, with every
+// block a multiple of the register tile so only the last one is ragged
+__forceinline__ int GetBlockSize(int extent, int max_block, int tile) {
+  int num_blocks = CeilDiv(extent, max_block);
+  return std::min(AlignUp(CeilDiv(extent, num_blocks), tile),
+                  std::max(AlignDown(max_block, tile), tile));
+}
+
+// KC does not need to align to anything, prefer a factor of K so the
+// reduction has no short tail block, unless that factor is too small
+__forceinline__ int GetKC(int K) {
+  int kc = GetMaxFactor(K, kMaxKC);
+  return kc >= kMaxKC / 2 ? kc : std::min(K, kMaxKC);
+}
+
+// pack an mc x kc block of row-major A into MR-row panels laid out as
+// [panel][k][MR] in fp32, zero filling the rows past mc
+template <int MR, typename TA>
+inline void PackA(int mc, int kc, const TA* A, int lda, float* packed) {
+  for (int i = 0; i < mc; i += MR, packed += MR * kc) {
+    const TA* a = A + i * lda;
+    if (mc - i >= MR) {
+      for (int p = 0; p < kc; p++) {
+        unroll_for<MR>([&](int r) __lambda_inline__ {
+          packed[p * MR + r] = static_cast<float>(a[r * lda + p]);
+        });
+      }
+    } else {
+      for (int p = 0; p < kc; p++) {
+        for (int r = 0; r < MR; r++) {
+          packed[p * MR + r] =
+              r < mc - i ? static_cast<float>(a[r * lda + p]) : 0.f;
+        }
+      }
+    }
+  }
+}
+
+// pack a kc x nc block of row-major B into NR-column panels laid out as
+// [panel][k][NR] in fp32, zero filling the columns past nc
+template <int NR, typename TB>
+inline void PackB(int kc, int nc, const TB* B, int ldb, float* packed) {
+  for (int j = 0; j < nc; j += NR, packed += NR * kc) {
+    const TB* b = B + j;
+    if (nc - j >= NR) {
+      for (int p = 0; p < kc; p++) {
+        unroll_for<NR>([&](int c) __lambda_inline__ {
+          packed[p * NR + c] = static_cast<float>(b[p * ldb + c]);
+        });
+      }
+    } else {
+      for (int p = 0; p < kc; p++) {
+        for (int c = 0; c < NR; c++) {
+          packed[p * NR + c] =
+              c < nc - j ? static_cast<float>(b[p * ldb + c]) : 0.f;
+        }
+      }
+    }
+  }
+}
+
+// floats in a vector register of the target
+#if defined(__AVX512F__)
+constexpr int kMaxLanes = 16;
+#elif defined(__AVX__)
+constexpr int kMaxLanes = 8;
+#else
+constexpr int kMaxLanes = 4;
+#endif
+
+// a row of the register tile is held as NR / kLanes vectors of kLanes
+// floats, kLanes being the largest power of 2 up to kMaxLanes dividing NR.
+// these are GCC / clang vector extensions, so the kernel is vectorized at
+// plain -O2 too, where the auto-vectorizer's cost model gives up on it
+template <int NR>
+struct RowVector {
+  static constexpr int kLanes = (NR & -NR) < kMaxLanes ? (NR & -NR) : kMaxLanes;
+  typedef float Type __attribute__((vector_size(kLanes * sizeof(float))));
+};
+
+// MR x NR register tile: acc += a_panel * b_panel over kc rank-1 updates,
+// the accumulators stay in vector registers for the whole loop
+template <int MR, int NR>
+__forceinline__ void MicroKernel(int kc, const float* a, const float* b,
+                                 NaiveArray<float, MR * NR>& acc) {
+  typedef typename RowVector<NR>::Type Vec;
+  constexpr int kLanes = RowVector<NR>::kLanes;
+  constexpr int kNV = NR / kLanes;
+
+  Vec c[MR * kNV];
+  unroll_for<MR * kNV>([&](int i) __lambda_inline__ {
+    std::memcpy(&c[i], &acc[i * kLanes], sizeof(Vec));
+  });
+
+  for (int p = 0; p < kc; p++, a += MR, b += NR) {
+    Vec b_row[kNV];
+    unroll_for<kNV>([&](int j) __lambda_inline__ {
+      std::memcpy(&b_row[j], b + j * kLanes, sizeof(Vec));
+    });
+    unroll_for<MR>([&](int i) __lambda_inline__ {
+      float a_i = a[i];
+      unroll_for<kNV>([&](int j) __lambda_inline__ {
+        c[i * kNV + j] += a_i * b_row[j];
+      });
+    });
+  }
+
+  unroll_for<MR * kNV>([&](int i) __lambda_inline__ {
+    std::memcpy(&acc[i * kLanes], &c[i], sizeof(Vec));
+  });
+}
+
+// C = alpha * acc + beta * C for an mr x nr corner of the tile,
+// C is not read when beta is 0
+template <int MR, int NR, typename TC>
+__forceinline__ void StoreTile(int mr, int nr,
+                               const NaiveArray<float, MR * NR>& acc,
+                               float alpha, float beta, TC* C, int ldc) {
+  auto store = [&](int i, int j) __lambda_inline__ {
+    float c = alpha * acc[i * NR + j];
+    if (beta != 0.f) c += beta * static_cast<float>(C[i * ldc + j]);
+    C[i * ldc + j] = static_cast<TC>(c);
+  };
+
+  if (mr == MR && nr == NR) {
+    unroll_for<MR>([&](int i) __lambda_inline__ {
+      unroll_for<NR>([&](int j) __lambda_inline__ { store(i, j); });
+    });
+  } else {
+    for (int i = 0; i < mr; i++) {
+      for (int j = 0; j < nr; j++) {
+        store(i, j);
+      }
+    }
+  }
+}
+
+// multiply a packed mc x kc block of A with a packed kc x nc panel of B
+// tile by tile, C = alpha * A * B + beta * C
+template <int MR, int NR, typename TC>
+inline void ComputeBlock(int mc, int nc, int kc, const float* packed_a,
+                         const float* packed_b, float alpha, float beta,
+                         TC* C, int ldc) {
+  for (int jr = 0; jr < nc; jr += NR) {
+    for (int ir = 0; ir < mc; ir += MR) {
+      NaiveArray<float, MR * NR> acc;
+      unroll_for<MR * NR>([&](int i) __lambda_inline__ { acc[i] = 0.f; });
+      MicroKernel<MR, NR>(kc, packed_a + ir * kc, packed_b + jr * kc, acc);
+      StoreTile<MR, NR>(std::min(MR, mc - ir), std::min(NR, nc - jr), acc,
+                        alpha, beta, C + ir * ldc + jr, ldc);
+    }
+  }
+}
+}  // namespace gemm_detail
+
+/* C = alpha * A * B + beta * C for row-major A (M x K), B (K x N), C (M x N)
+ * TA and TB may be float, __fp16 or __bf16, they are widened to fp32 while
+ * packing and all products are accumulated in fp32, TC is the output type.
+ * a float C accumulates the KC blocks in place, any other C gets an fp32
+ * MC x NC scratch block and is rounded to TC once at the end.
+ * MR x NR is the register tile, pick it so that MR * NR accumulators plus one
+ * row of A and B fit in the vector register file of the target, e.g. 6 x 16
+ * for AVX2 or 8 x 12 for NEON, with NR a multiple of the vector width.
+ * the tile is vectorized at -O2 already, but its vector width follows the
+ * compile flags: build with the target's vector isa enabled (e.g. -mavx2
+ * -mfma or -march=native), otherwise x86 falls back to 4-wide SSE vectors.
+ */
+template <int MR = 6, int NR = 16, typename TA, typename TB, typename TC>
+inline void Gemm(int M, int N, int K, float alpha, const TA* A, int lda,
+                 const TB* B, int ldb, float beta, TC* C, int ldc) {
+  static_assert(MR > 0 && NR > 0, "register tile must not be empty!");
+  using namespace gemm_detail;
+  if (M <= 0 || N <= 0) return;
+
+  const int MC = GetBlockSize(M, kMaxMC, MR);
+  const int NC = GetBlockSize(N, kMaxNC, NR);
+  const int KC = GetKC(std::max(K, 1));
+  // an empty reduction still has to scale C, so run one empty KC block
+  const int K_loop = std::max(K, 1);
+
+  std::vector<float> packed_a(MC * KC);
+  std::vector<float> packed_b(NC * KC);
+
+  UTILS_CONSTEXPR_IF (std::is_same<TC, float>::value) {
+    // packed B is reused by every MC block of A
+    for (int jc = 0; jc < N; jc += NC) {
+      const int nc = std::min(NC, N - jc);
+      for (int pc = 0; pc < K_loop; pc += KC) {
+        const int kc = std::max(std::min(KC, K - pc), 0);
+        PackB<NR>(kc, nc, B + pc * ldb + jc, ldb, packed_b.data());
+
+        for (int ic = 0; ic < M; ic += MC) {
+          const int mc = std::min(MC, M - ic);
+          PackA<MR>(mc, kc, A + ic * lda + pc, lda, packed_a.data());
+          ComputeBlock<MR, NR>(mc, nc, kc, packed_a.data(), packed_b.data(),
+                               alpha, pc == 0 ? beta : 1.f,
+                               C + ic * ldc + jc, ldc);
+        }
+      }
+    }
+  } else {
+    // the KC loop runs innermost over an fp32 scratch block, which costs
+    // repacking B once per MC block, i.e. 1 / MC of the multiply-adds
+    std::vector<float> scratch(MC * NC);
+    for (int jc = 0; jc < N; jc += NC) {
+      const int nc = std::min(NC, N - jc);
+      for (int ic = 0; ic < M; ic += MC) {
+        const int mc = std::min(MC, M - ic);
+        for (int pc = 0; pc < K_loop; pc += KC) {
+          const int kc = std::max(std::min(KC, K - pc), 0);
+          PackB<NR>(kc, nc, B + pc * ldb + jc, ldb, packed_b.data());
+          PackA<MR>(mc, kc, A + ic * lda + pc, lda, packed_a.data());
+          ComputeBlock<MR, NR>(mc, nc, kc, packed_a.data(), packed_b.data(),
+                               alpha, pc == 0 ? 0.f : 1.f, scratch.data(),
+                               NC);
+        }
+
+        TC* c = C + ic * ldc + jc;
+        for (int i = 0; i < mc; i++) {
+          for (int j = 0; j < nc; j++) {
+            float value = scratch[i * NC + j];
+            if (beta != 0.f) value += beta * static_cast<float>(c[i * ldc + j]);
+            c[i * ldc + j] = static_cast<TC>(value);
+          }
+        }
+      }
+    }
+  }
+}
+}  // namespace utils
+
+#endif  // UTILS_GEMM_H
@@ -0,0 +1,140 @@
+#ifndef UTILS_INSTRUMENT_H
+#define UTILS_INSTRUMENT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "macros.h"
+
+#if UTILS_ARCH_X86
+#include <x86intrin.h>
+#endif
+
+namespace utils {
+// raw cycle counter: rdtsc on x86, the virtual counter on arm64,
+// nanoseconds of a steady clock elsewhere
+__forceinline__ uint64_t ReadCycleCounter() {
+#if UTILS_ARCH_X86
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t value;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// call and cycle counts of one instrumented kernel
+struct KernelStats {
+  explicit KernelStats(const char* name) : name(name) {}
+
+  const char* name;
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> cycles{0};
+};
+
+namespace instrument_detail {
+inline std::mutex& GetRegistryMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline std::vector<std::unique_ptr<KernelStats>>& GetRegistry() {
+  static std::vector<std::unique_ptr<KernelStats>> registry;
+  return registry;
+}
+}  // namespace instrument_detail
+
+// stats of the kernel called name, created on first use and alive until exit
+inline KernelStats& GetKernelStats(const char* name) {
+  using namespace instrument_detail;
+  std::lock_guard<std::mutex> lock(GetRegistryMutex());
+  for (auto& stats : GetRegistry()) {
+    if (std::strcmp(stats->name, name) == 0) return *stats;
+  }
+  GetRegistry().emplace_back(new KernelStats(name));
+  return *GetRegistry().back();
+}
+
+// adds one call and the cycles spent in its scope to a kernel's stats
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(KernelStats& stats)
+      : stats_(stats), start_(ReadCycleCounter()) {}
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  ~ScopedTimer() {
+    stats_.cycles.fetch_add(ReadCycleCounter() - start_,
+                            std::memory_order_relaxed);
+    stats_.calls.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  KernelStats& stats_;
+  uint64_t start_;
+};
+
+// print calls, total and average cycles of every kernel seen so far
+inline void DumpKernelReport(FILE* out = stderr) {
+  using namespace instrument_detail;
+  std::lock_guard<std::mutex> lock(GetRegistryMutex());
+  std::fprintf(out, "%-32s %12s %16s %12s\n", "kernel", "calls", "cycles",
+               "cycles/call");
+  for (auto& stats : GetRegistry()) {
+    uint64_t calls = stats->calls.load(std::memory_order_relaxed);
+    uint64_t cycles = stats->cycles.load(std::memory_order_relaxed);
+    std::fprintf(out, "%-32s %12llu %16llu %12.1f\n", stats->name,
+                 static_cast<unsigned long long>(calls),
+                 static_cast<unsigned long long>(cycles),
+                 calls > 0 ? static_cast<double>(cycles) / calls : 0.0);
+  }
+}
+
+inline void ResetKernelStats() {
+  using namespace instrument_detail;
+  std::lock_guard<std::mutex> lock(GetRegistryMutex());
+  for (auto& stats : GetRegistry()) {
+    stats->calls.store(0, std::memory_order_relaxed);
+    stats->cycles.store(0, std::memory_order_relaxed);
+  }
+}
+}  // namespace utils
+
+/* usage of the instrumentation macros, inside a function body:
+ *    UTILS_PROFILE_SCOPE("name");  // time the rest of the scope
+ *    UTILS_COUNT_CALL("name");     // only count calls
+ * and utils::DumpKernelReport() to print the stats. the lookup of the stats
+ * happens once per call site. unless UTILS_ENABLE_INSTRUMENTATION is 1 the
+ * macros expand to nothing, so they can stay in hot paths.
+ */
+#if UTILS_ENABLE_INSTRUMENTATION
+#define UTILS_PROFILE_SCOPE_IMPL(name, id)                       \
+  static ::utils::KernelStats& UTILS_CONCAT(utils_stats_, id) =  \
+      ::utils::GetKernelStats(name);                             \
+  ::utils::ScopedTimer UTILS_CONCAT(utils_timer_, id)(           \
+      UTILS_CONCAT(utils_stats_, id))
+#define UTILS_PROFILE_SCOPE(name) UTILS_PROFILE_SCOPE_IMPL(name, __COUNTER__)
+
+#define UTILS_COUNT_CALL_IMPL(name, id)                          \
+  static ::utils::KernelStats& UTILS_CONCAT(utils_stats_, id) =  \
+      ::utils::GetKernelStats(name);                             \
+  UTILS_CONCAT(utils_stats_, id)                                 \
+      .calls.fetch_add(1, std::memory_order_relaxed)
+#define UTILS_COUNT_CALL(name) UTILS_COUNT_CALL_IMPL(name, __COUNTER__)
+#else
+#define UTILS_PROFILE_SCOPE(name) (void)0
+#define UTILS_COUNT_CALL(name) (void)0
+#endif
+
+#endif  // UTILS_INSTRUMENT_H
@@ -17,4 +17,30 @@
 
 #define __forceinline__ inline __attribute__((always_inline, internal_linkage))
 
+#define UTILS_CONCAT_IMPL(a, b) a##b
+#define UTILS_CONCAT(a, b) UTILS_CONCAT_IMPL(a, b)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTILS_ARCH_X86 1
+#else
+#define UTILS_ARCH_X86 0
+#endif
+
+// compile a function for a given instruction set, e.g. UTILS_TARGET("avx2")
+#define UTILS_TARGET(isa) __attribute__((target(isa)))
+// compile a function for several instruction sets and let the loader pick,
+// e.g. UTILS_TARGET_CLONES("avx512f", "avx2", "default")
+#define UTILS_TARGET_CLONES(...) __attribute__((target_clones(__VA_ARGS__)))
+
+#if UTILS_ARCH_X86
+#define UTILS_TARGET_AVX2 UTILS_TARGET("avx2,fma")
+#define UTILS_TARGET_AVX512 \
+  UTILS_TARGET("avx512f,avx512bw,avx512vl,avx512dq,avx2,fma")
+#endif
+
+// timers and counters of instrument.h compile to nothing unless this is 1
+#ifndef UTILS_ENABLE_INSTRUMENTATION
+#define UTILS_ENABLE_INSTRUMENTATION 0
+#endif
+
 #endif  // UTILS_MACROS_H
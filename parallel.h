@@ -0,0 +1,80 @@
+#ifndef UTILS_PARALLEL_H
+#define UTILS_PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "math_utils.h"
+
+namespace utils {
+// reusable barrier for a fixed team of threads
+class Barrier {
+ public:
+  explicit Barrier(int num_threads)
+      : num_threads_(num_threads), count_(num_threads), generation_(0) {}
+
+  Barrier(const Barrier&) = delete;
+  Barrier& operator=(const Barrier&) = delete;
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t generation = generation_;
+    if (--count_ == 0) {
+      generation_++;
+      count_ = num_threads_;
+      cv_.notify_all();
+      return;
+    }
+    cv_.wait(lock, [&] { return generation != generation_; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int num_threads_;
+  int count_;
+  size_t generation_;
+};
+
+// run func(thread_id) on a team of num_threads threads, the calling thread
+// works as thread 0
+template <typename Func>
+inline void ParallelRun(int num_threads, Func&& func) {
+  if (num_threads <= 1) {
+    func(0);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  workers.reserve(num_threads - 1);
+  for (int tid = 1; tid < num_threads; tid++) {
+    workers.emplace_back([&func, tid] { func(tid); });
+  }
+  func(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+// split [0, n) into contiguous chunks aligned to grain and run
+// func(begin, end) on each chunk, one chunk per thread
+template <typename Func>
+inline void ParallelFor(size_t n, size_t grain, int num_threads, Func&& func) {
+  if (n == 0) return;
+
+  size_t num_chunks = std::max(num_threads, 1);
+  size_t chunk = AlignUp(CeilDiv(n, num_chunks), std::max<size_t>(grain, 1));
+  num_chunks = CeilDiv(n, chunk);
+
+  ParallelRun(static_cast<int>(num_chunks), [&](int tid) {
+    size_t begin = tid * chunk;
+    func(begin, std::min(n, begin + chunk));
+  });
+}
+}  // namespace utils
+
+#endif  // UTILS_PARALLEL_H
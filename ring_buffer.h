@@ -0,0 +1,245 @@
+#ifndef UTILS_RING_BUFFER_H
+#define UTILS_RING_BUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "math_utils.h"
+
+namespace utils {
+// size of a cache line, used to keep producer and consumer state apart.
+// the queues pad with a whole line instead of alignas, which would make them
+// over-aligned and break plain new and make_shared before C++17. with a full
+// line between them, two groups never share a line wherever the object lies
+constexpr size_t kCacheLineSize = 64;
+
+// round capacity up to a power of 2 (at least 2) so indices wrap with a mask,
+// capacity must not exceed 2^31
+__forceinline__ uint32_t GetRingCapacity(uint32_t capacity) {
+  assert(capacity <= 1U << 31);
+  return AlignUpPow2(std::max(capacity, 2U));
+}
+
+/* single-producer single-consumer bounded queue
+ * head and tail only ever grow and wrap with the mask when indexing. each
+ * side keeps a cached copy of the other side's index and only reloads it
+ * when the cache says the queue is full (producer) or empty (consumer), so
+ * the shared cache lines are touched once per wrap rather than per element.
+ */
+template <typename T>
+class SpscRingBuffer {
+ public:
+  explicit SpscRingBuffer(uint32_t capacity)
+      : mask_(GetRingCapacity(capacity) - 1), buffer_(new T[mask_ + 1]) {}
+
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+  size_t Capacity() const { return mask_ + 1; }
+
+  // approximate when called concurrently with push or pop
+  size_t Size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
+  }
+
+  // producer side
+  template <typename U>
+  bool TryPush(U&& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) return false;
+    }
+    buffer_[tail & mask_] = std::forward<U>(item);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // push up to n items with a single publish, returns the number pushed
+  size_t TryPushBatch(const T* items, size_t n) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t free = mask_ + 1 - (tail - cached_head_);
+    if (free < n) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      free = mask_ + 1 - (tail - cached_head_);
+    }
+    n = std::min(n, free);
+    for (size_t i = 0; i < n; i++) {
+      buffer_[(tail + i) & mask_] = items[i];
+    }
+    tail_.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  // consumer side
+  bool TryPop(T& item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return false;
+    }
+    item = std::move(buffer_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // pop up to n items with a single release, returns the number popped
+  size_t TryPopBatch(T* items, size_t n) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ - head < n) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    n = std::min(n, cached_tail_ - head);
+    for (size_t i = 0; i < n; i++) {
+      items[i] = std::move(buffer_[(head + i) & mask_]);
+    }
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+ private:
+  const size_t mask_;
+  const std::unique_ptr<T[]> buffer_;
+  char pad0_[kCacheLineSize] __attribute__((unused));
+
+  // consumer owned
+  std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  char pad1_[kCacheLineSize] __attribute__((unused));
+
+  // producer owned
+  std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  char pad2_[kCacheLineSize] __attribute__((unused));
+};
+
+/* multi-producer multi-consumer bounded queue (Dmitry Vyukov's design)
+ * every cell carries a sequence number telling whose turn it is: a cell at
+ * position pos is free for the producer of pos when sequence == pos, and
+ * holds data for the consumer of pos when sequence == pos + 1. producers and
+ * consumers claim positions with a CAS on their own index and never wait on
+ * each other unless the queue is full or empty.
+ */
+template <typename T>
+class MpmcRingBuffer {
+ public:
+  explicit MpmcRingBuffer(uint32_t capacity)
+      : mask_(GetRingCapacity(capacity) - 1), cells_(new Cell[mask_ + 1]) {
+    for (size_t i = 0; i <= mask_; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpmcRingBuffer(const MpmcRingBuffer&) = delete;
+  MpmcRingBuffer& operator=(const MpmcRingBuffer&) = delete;
+
+  size_t Capacity() const { return mask_ + 1; }
+
+  // approximate when called concurrently with push or pop
+  size_t Size() const {
+    size_t tail = enqueue_pos_.load(std::memory_order_acquire);
+    size_t head = dequeue_pos_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+
+  template <typename U>
+  bool TryPush(U&& item) {
+    size_t pos = 0;
+    if (Claim<0>(enqueue_pos_, 1, pos) == 0) return false;
+    Cell& cell = cells_[pos & mask_];
+    cell.data = std::forward<U>(item);
+    cell.sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPop(T& item) {
+    size_t pos = 0;
+    if (Claim<1>(dequeue_pos_, 1, pos) == 0) return false;
+    Cell& cell = cells_[pos & mask_];
+    item = std::move(cell.data);
+    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // claim up to n consecutive free cells with a single CAS, returns the
+  // number pushed
+  size_t TryPushBatch(const T* items, size_t n) {
+    size_t pos = 0;
+    n = Claim<0>(enqueue_pos_, n, pos);
+    for (size_t i = 0; i < n; i++) {
+      Cell& cell = cells_[(pos + i) & mask_];
+      cell.data = items[i];
+      cell.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  // claim up to n consecutive filled cells with a single CAS, returns the
+  // number popped
+  size_t TryPopBatch(T* items, size_t n) {
+    size_t pos = 0;
+    n = Claim<1>(dequeue_pos_, n, pos);
+    for (size_t i = 0; i < n; i++) {
+      Cell& cell = cells_[(pos + i) & mask_];
+      items[i] = std::move(cell.data);
+      cell.sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  // claim up to n cells starting at index whose sequence is pos + LAG
+  // (0 for producers, 1 for consumers), stores the first claimed position
+  // in pos and returns the number of cells claimed, 0 if full or empty
+  template <int LAG>
+  size_t Claim(std::atomic<size_t>& index, size_t n, size_t& pos) {
+    pos = index.load(std::memory_order_relaxed);
+    while (true) {
+      size_t count = 0;
+      for (; count < n && count <= mask_; count++) {
+        size_t sequence = cells_[(pos + count) & mask_].sequence.load(
+            std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) -
+                        static_cast<intptr_t>(pos + count + LAG);
+        if (diff == 0) continue;
+        if (diff < 0 || count > 0) break;
+        // another thread moved past pos, reload and retry
+        count = n + 1;
+        break;
+      }
+
+      if (count > n) {
+        pos = index.load(std::memory_order_relaxed);
+      } else if (count == 0) {
+        return 0;
+      } else if (index.compare_exchange_weak(pos, pos + count,
+                                             std::memory_order_relaxed)) {
+        return count;
+      }
+    }
+  }
+
+  const size_t mask_;
+  const std::unique_ptr<Cell[]> cells_;
+  char pad0_[kCacheLineSize] __attribute__((unused));
+
+  std::atomic<size_t> enqueue_pos_{0};
+  char pad1_[kCacheLineSize] __attribute__((unused));
+
+  std::atomic<size_t> dequeue_pos_{0};
+  char pad2_[kCacheLineSize] __attribute__((unused));
+};
+}  // namespace utils
+
+#endif  // UTILS_RING_BUFFER_H
@@ -0,0 +1,184 @@
+#ifndef UTILS_SCAN_H
+#define UTILS_SCAN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "math_utils.h"
+#include "naive_array.h"
+#include "parallel.h"
+#include "unroller.h"
+
+namespace utils {
+namespace scan_detail {
+// bytes of input a thread scans per round of the parallel scan, small enough
+// that the second pass still finds them in L2, and the least input per
+// thread worth starting the threads for
+constexpr size_t kMinChunkBytes = 256 * 1024;
+
+template <typename T>
+struct Identity {
+  __forceinline__ T operator()(T x) const { return x; }
+};
+
+template <typename T>
+struct AlignUpTo {
+  T alignment;
+  __forceinline__ T operator()(T x) const { return AlignUp(x, alignment); }
+};
+}  // namespace scan_detail
+
+// inclusive scan of a tile in registers starting from carry, fully unrolled
+// with a sequential carry: one add per lane, which beats a log-step scan as
+// NaiveArray lanes are scalars rather than vector lanes.
+// returns the sum of carry and all lanes
+template <typename T, int N, int alignment>
+__forceinline__ T InclusiveScanTile(NaiveArray<T, N, alignment>& tile,
+                                    T carry = T()) {
+  unroll_for<N>([&](int i) __lambda_inline__ {
+    carry += tile[i];
+    tile[i] = carry;
+  });
+  return carry;
+}
+
+// exclusive scan of a tile in registers starting from carry,
+// returns the sum of carry and all lanes
+template <typename T, int N, int alignment>
+__forceinline__ T ExclusiveScanTile(NaiveArray<T, N, alignment>& tile,
+                                    T carry = T()) {
+  unroll_for<N>([&](int i) __lambda_inline__ {
+    T value = tile[i];
+    tile[i] = carry;
+    carry += value;
+  });
+  return carry;
+}
+
+namespace scan_detail {
+// sum of op(in[i]) for i in [0, n), accumulated lane-wise in a tile
+template <int TILE, typename T, typename Op>
+inline T Reduce(const T* in, size_t n, Op op) {
+  NaiveArray<T, TILE> acc;
+  unroll_for<TILE>([&](int j) __lambda_inline__ { acc[j] = T(); });
+
+  size_t i = 0;
+  for (size_t n_main = AlignDown(n, TILE); i < n_main; i += TILE) {
+    unroll_for<TILE>([&](int j) __lambda_inline__ { acc[j] += op(in[i + j]); });
+  }
+
+  T sum = T();
+  unroll_for<TILE>([&](int j) __lambda_inline__ { sum += acc[j]; });
+  for (; i < n; i++) {
+    sum += op(in[i]);
+  }
+  return sum;
+}
+
+// serial scan of op(in[i]) with the loop unrolled TILE times and a
+// sequential carry, safe for in == out,
+// returns carry plus the sum of all elements
+template <bool EXCLUSIVE, int TILE, typename T, typename Op>
+inline T ScanSerial(const T* in, T* out, size_t n, T carry, Op op) {
+  size_t i = 0;
+  for (size_t n_main = AlignDown(n, TILE); i < n_main; i += TILE) {
+    unroll_for<TILE>([&](int j) __lambda_inline__ {
+      T value = op(in[i + j]);
+      out[i + j] = EXCLUSIVE ? carry : carry + value;
+      carry += value;
+    });
+  }
+
+  for (; i < n; i++) {
+    T value = op(in[i]);
+    out[i] = EXCLUSIVE ? carry : carry + value;
+    carry += value;
+  }
+  return carry;
+}
+
+// cache-blocked two-pass parallel scan, run in rounds: every round each
+// thread reduces its own L2-sized slice, waits once for the others, adds the
+// carry of the previous rounds and the sums of the slices before its own,
+// then scans its slice again while it is still in L2. the slice sums are
+// double buffered, so no thread overwrites a sum another one still reads
+// and one barrier per round is enough
+template <bool EXCLUSIVE, int TILE, typename T, typename Op>
+inline T Scan(const T* in, T* out, size_t n, T init, int num_threads, Op op) {
+  const size_t slice =
+      AlignUp(std::max<size_t>(kMinChunkBytes / sizeof(T), 1), TILE);
+  num_threads = std::min<size_t>(std::max(num_threads, 1), CeilDiv(n, slice));
+  if (num_threads <= 1) {
+    return ScanSerial<EXCLUSIVE, TILE>(in, out, n, init, op);
+  }
+
+  const size_t round = slice * num_threads;
+  std::vector<T> sums(2 * num_threads);
+  Barrier barrier(num_threads);
+  T total = init;
+
+  ParallelRun(num_threads, [&](int tid) {
+    // every thread tracks the carry itself, adding the sums in the same order
+    T carry = init;
+    for (size_t base = 0, r = 0; base < n; base += round, r++) {
+      T* round_sums = sums.data() + (r & 1) * num_threads;
+      const size_t begin = std::min(n, base + tid * slice);
+      const size_t end = std::min(n, begin + slice);
+
+      round_sums[tid] = Reduce<TILE>(in + begin, end - begin, op);
+      barrier.Wait();
+
+      T offset = carry;
+      for (int t = 0; t < num_threads; t++) {
+        if (t == tid) offset = carry;
+        carry += round_sums[t];
+      }
+      ScanSerial<EXCLUSIVE, TILE>(in + begin, out + begin, end - begin,
+                                  offset, op);
+    }
+    if (tid == 0) total = carry;
+  });
+
+  return total;
+}
+}  // namespace scan_detail
+
+/* usage of the array scans:
+ *    out[i] = init + in[0] + ... + in[i]      (InclusiveScan)
+ *    out[i] = init + in[0] + ... + in[i - 1]  (ExclusiveScan)
+ * all of them return init plus the sum of the whole input, support in == out
+ * and go multi-threaded for num_threads > 1 once every thread gets at least
+ * kMinChunkBytes of input, then scan in rounds of kMinChunkBytes per thread
+ * so that the input is read from memory once. TILE is the unroll factor of
+ * the serial loop.
+ * the parallel path sums in a different order, so floating point results may
+ * differ from the serial path in the last bits.
+ */
+template <int TILE = 8, typename T>
+inline T InclusiveScan(const T* in, T* out, size_t n, T init = T(),
+                       int num_threads = 1) {
+  return scan_detail::Scan<false, TILE>(in, out, n, init, num_threads,
+                                        scan_detail::Identity<T>());
+}
+
+template <int TILE = 8, typename T>
+inline T ExclusiveScan(const T* in, T* out, size_t n, T init = T(),
+                       int num_threads = 1) {
+  return scan_detail::Scan<true, TILE>(in, out, n, init, num_threads,
+                                       scan_detail::Identity<T>());
+}
+
+// exclusive scan of sizes each rounded up to alignment, i.e. the offsets of
+// buffers packed back to back with every buffer starting aligned
+template <int TILE = 8, typename T>
+inline T AlignedExclusiveScan(const T* in, T* out, size_t n, T alignment,
+                              T init = T(), int num_threads = 1) {
+  static_assert(std::is_integral<T>::value,
+                "AlignedExclusiveScan only supports integral types!");
+  return scan_detail::Scan<true, TILE>(in, out, n, init, num_threads,
+                                       scan_detail::AlignUpTo<T>{alignment});
+}
+}  // namespace utils
+
+#endif  // UTILS_SCAN_H
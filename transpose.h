@@ -0,0 +1,383 @@
+#ifndef UTILS_TRANSPOSE_H
+#define UTILS_TRANSPOSE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "math_utils.h"
+#include "naive_array.h"
+#include "parallel.h"
+#include "unroller.h"
+
+namespace utils {
+namespace transpose_detail {
+// upper bound of a cache block side in elements, a 64 x 64 block of 4-byte
+// elements keeps both source and destination within L1
+constexpr size_t kMaxBlock = 64;
+
+// largest short side of the edge strip kernels, see TransposeSerial
+constexpr int kMaxStrip = 8;
+
+// side of the register micro-tile: 8 x 8 for 4-byte elements,
+// 16 x 16 for 1- and 2-byte ones
+template <typename T>
+struct TileSize {
+  static constexpr int value = sizeof(T) >= 4 ? 8 : 16;
+};
+
+// block side as a multiple of tile covering extent (already aligned down to
+// tile), prefer a factor so every block is full unless that factor is tiny
+__forceinline__ size_t GetBlockSize(size_t extent, size_t tile) {
+  size_t max_tiles = kMaxBlock / tile;
+  size_t tiles = GetMaxFactor(extent / tile, max_tiles);
+  return (tiles >= max_tiles / 2 ? tiles : max_tiles) * tile;
+}
+
+// dst[j * ldd + i] = src[i * lds + j] for a TILE x TILE tile via registers
+template <int TILE, typename T>
+__forceinline__ void TransposeTile(const T* src, size_t lds, T* dst,
+                                   size_t ldd) {
+  NaiveArray<T, TILE * TILE> tile;
+  unroll_for<TILE>([&](int i) __lambda_inline__ {
+    unroll_for<TILE>([&](int j) __lambda_inline__ {
+      tile[i * TILE + j] = src[i * lds + j];
+    });
+  });
+  unroll_for<TILE>([&](int j) __lambda_inline__ {
+    unroll_for<TILE>([&](int i) __lambda_inline__ {
+      dst[j * ldd + i] = tile[i * TILE + j];
+    });
+  });
+}
+
+// swap tile a at (I, J) with the transpose of tile b at (J, I), a == b
+// transposes a diagonal tile in place
+template <int TILE, typename T>
+__forceinline__ void SwapTransposeTiles(T* a, T* b, size_t lda) {
+  NaiveArray<T, TILE * TILE> tile_a;
+  NaiveArray<T, TILE * TILE> tile_b;
+  unroll_for<TILE>([&](int i) __lambda_inline__ {
+    unroll_for<TILE>([&](int j) __lambda_inline__ {
+      tile_a[i * TILE + j] = a[i * lda + j];
+      tile_b[i * TILE + j] = b[i * lda + j];
+    });
+  });
+  unroll_for<TILE>([&](int i) __lambda_inline__ {
+    unroll_for<TILE>([&](int j) __lambda_inline__ {
+      a[i * lda + j] = tile_b[j * TILE + i];
+      b[i * lda + j] = tile_a[j * TILE + i];
+    });
+  });
+}
+
+// transpose an R x cols strip with R < TILE through an R x TILE register
+// tile, TILE columns at a time, cols must be a multiple of TILE
+template <int R, int TILE, typename T>
+__forceinline__ void TransposeRowStrip(size_t cols, const T* src, size_t lds,
+                                       T* dst, size_t ldd) {
+  for (size_t j = 0; j < cols; j += TILE) {
+    NaiveArray<T, R * TILE> tile;
+    unroll_for<R>([&](int i) __lambda_inline__ {
+      unroll_for<TILE>([&](int c) __lambda_inline__ {
+        tile[i * TILE + c] = src[i * lds + j + c];
+      });
+    });
+    unroll_for<TILE>([&](int c) __lambda_inline__ {
+      unroll_for<R>([&](int i) __lambda_inline__ {
+        dst[(j + c) * ldd + i] = tile[i * TILE + c];
+      });
+    });
+  }
+}
+
+// transpose a TILE x C strip with C < TILE through a C x TILE register tile
+template <int C, int TILE, typename T>
+__forceinline__ void TransposeColStrip(const T* src, size_t lds, T* dst,
+                                       size_t ldd) {
+  NaiveArray<T, C * TILE> tile;
+  unroll_for<TILE>([&](int r) __lambda_inline__ {
+    unroll_for<C>([&](int j) __lambda_inline__ {
+      tile[j * TILE + r] = src[r * lds + j];
+    });
+  });
+  unroll_for<C>([&](int j) __lambda_inline__ {
+    unroll_for<TILE>([&](int r) __lambda_inline__ {
+      dst[j * ldd + r] = tile[j * TILE + r];
+    });
+  });
+}
+
+// run the strip kernel whose compile-time size INDEX matches the runtime
+// rows (cols for ColStripDispatch) of the edge
+template <int INDEX, class... Types>
+struct RowStripDispatch {
+  template <int TILE, typename T>
+  __forceinline__ static void call(std::integral_constant<int, TILE>,
+                                   size_t rows, size_t cols, const T* src,
+                                   size_t lds, T* dst, size_t ldd) {
+    if (rows != INDEX) return;
+    TransposeRowStrip<INDEX, TILE>(cols, src, lds, dst, ldd);
+  }
+};
+
+template <int INDEX, class... Types>
+struct ColStripDispatch {
+  template <int TILE, typename T>
+  __forceinline__ static void call(std::integral_constant<int, TILE>,
+                                   size_t rows, size_t cols, const T* src,
+                                   size_t lds, T* dst, size_t ldd) {
+    if (cols != INDEX) return;
+    for (size_t i = 0; i < rows; i += TILE) {
+      TransposeColStrip<INDEX, TILE>(src + i * lds, lds, dst + i, ldd);
+    }
+  }
+};
+
+// single-threaded cache-blocked out-of-place transpose
+template <typename T>
+inline void TransposeSerial(size_t rows, size_t cols, const T* src,
+                            size_t lds, T* dst, size_t ldd) {
+  constexpr int kTile = TileSize<T>::value;
+  const size_t rows_main = AlignDown(rows, kTile);
+  const size_t cols_main = AlignDown(cols, kTile);
+  const size_t block_r = GetBlockSize(rows_main, kTile);
+  const size_t block_c = GetBlockSize(cols_main, kTile);
+
+  for (size_t i0 = 0; i0 < rows_main; i0 += block_r) {
+    const size_t i_end = std::min(i0 + block_r, rows_main);
+    for (size_t j0 = 0; j0 < cols_main; j0 += block_c) {
+      const size_t j_end = std::min(j0 + block_c, cols_main);
+      for (size_t i = i0; i < i_end; i += kTile) {
+        for (size_t j = j0; j < j_end; j += kTile) {
+          TransposeTile<kTile>(src + i * lds + j, lds, dst + j * ldd + i, ldd);
+        }
+      }
+    }
+  }
+
+  // edges narrower than a tile still go through registers, with the short
+  // side unrolled at compile time, which covers skinny planes such as the
+  // 3 x HW one of NCHW -> NHWC. to bound the number of kernels, an edge of
+  // kMaxStrip or more (16-wide tiles only) first takes one kMaxStrip strip
+  using TileTag = std::integral_constant<int, kTile>;
+  size_t i_edge = rows_main;
+  size_t j_edge = cols_main;
+  if (rows - i_edge >= kMaxStrip) {
+    TransposeRowStrip<kMaxStrip, kTile>(cols_main, src + i_edge * lds, lds,
+                                        dst + i_edge, ldd);
+    i_edge += kMaxStrip;
+  }
+  if (cols - j_edge >= kMaxStrip) {
+    for (size_t i = 0; i < rows_main; i += kTile) {
+      TransposeColStrip<kMaxStrip, kTile>(src + i * lds + j_edge, lds,
+                                          dst + j_edge * ldd + i, ldd);
+    }
+    j_edge += kMaxStrip;
+  }
+  unroll_for<1, kMaxStrip, RowStripDispatch>(TileTag(), rows - i_edge,
+                                             cols_main, src + i_edge * lds,
+                                             lds, dst + i_edge, ldd);
+  unroll_for<1, kMaxStrip, ColStripDispatch>(TileTag(), rows_main,
+                                             cols - j_edge, src + j_edge, lds,
+                                             dst + j_edge * ldd, ldd);
+  for (size_t i = rows_main; i < rows; i++) {
+    for (size_t j = cols_main; j < cols; j++) {
+      dst[j * ldd + i] = src[i * lds + j];
+    }
+  }
+}
+
+// whether perm holds every index of [0, nd) exactly once
+inline bool IsPermutation(const std::vector<int>& perm, size_t nd) {
+  if (perm.size() != nd) return false;
+  std::vector<bool> seen(nd, false);
+  for (int d : perm) {
+    if (d < 0 || static_cast<size_t>(d) >= nd || seen[d]) return false;
+    seen[d] = true;
+  }
+  return true;
+}
+}  // namespace transpose_detail
+
+// out-of-place transpose of a rows x cols matrix:
+// dst[j * ldd + i] = src[i * lds + j], src and dst must not overlap
+// works for any element type, tiles are tuned for 1-, 2- and 4-byte ones
+// such as uint8_t, __fp16, __bf16 and float
+template <typename T>
+inline void Transpose(size_t rows, size_t cols, const T* src, size_t lds,
+                      T* dst, size_t ldd, int num_threads = 1) {
+  using namespace transpose_detail;
+  // split the longer side in tile-aligned chunks so that skinny matrices
+  // use every thread too
+  if (rows >= cols) {
+    ParallelFor(rows, TileSize<T>::value, num_threads,
+                [&](size_t begin, size_t end) {
+                  TransposeSerial(end - begin, cols, src + begin * lds, lds,
+                                  dst + begin, ldd);
+                });
+  } else {
+    ParallelFor(cols, TileSize<T>::value, num_threads,
+                [&](size_t begin, size_t end) {
+                  TransposeSerial(rows, end - begin, src + begin, lds,
+                                  dst + begin * ldd, ldd);
+                });
+  }
+}
+
+// in-place transpose of an n x n matrix with leading dimension lda
+template <typename T>
+inline void TransposeInPlace(size_t n, T* a, size_t lda, int num_threads = 1) {
+  using namespace transpose_detail;
+  constexpr int kTile = TileSize<T>::value;
+  const size_t n_main = AlignDown(n, kTile);
+  const size_t block = GetBlockSize(n_main, kTile);
+  const size_t num_blocks = CeilDiv(n_main, block);
+
+  // every pair of blocks (bi, bj >= bi) is owned by the thread of bi,
+  // block rows are dealt round-robin to balance the triangle
+  num_threads = std::min<size_t>(std::max(num_threads, 1), num_blocks);
+  ParallelRun(num_threads, [&](int tid) {
+    for (size_t bi = tid; bi < num_blocks; bi += num_threads) {
+      const size_t i0 = bi * block;
+      const size_t i_end = std::min(i0 + block, n_main);
+      for (size_t j0 = i0; j0 < n_main; j0 += block) {
+        const size_t j_end = std::min(j0 + block, n_main);
+        for (size_t i = i0; i < i_end; i += kTile) {
+          for (size_t j = std::max(i, j0); j < j_end; j += kTile) {
+            SwapTransposeTiles<kTile>(a + i * lda + j, a + j * lda + i, lda);
+          }
+        }
+      }
+    }
+  });
+
+  // edges narrower than a tile
+  for (size_t j = n_main; j < n; j++) {
+    for (size_t i = 0; i < j; i++) {
+      std::swap(a[i * lda + j], a[j * lda + i]);
+    }
+  }
+}
+
+/* general N-d permutation of a dense row-major tensor:
+ *    dst has shape[perm[0]] x ... x shape[perm[nd - 1]] and
+ *    dst[..., k_d, ...] = src[..., k_perm[d], ...]
+ * e.g. NCHW -> NHWC is Permute(src, dst, {N, C, H, W}, {0, 2, 3, 1}).
+ * size-1 dims are dropped and dims that stay adjacent are merged first, so
+ * NCHW -> NHWC runs as N transposes of a C x HW plane. when the innermost dim
+ * moves, every plane is a blocked 2-d transpose, otherwise contiguous rows
+ * are copied. the loop over planes (or rows) is split across threads.
+ * perm must hold every index of [0, shape.size()) exactly once.
+ */
+template <typename T>
+inline void Permute(const T* src, T* dst, const std::vector<size_t>& shape,
+                    const std::vector<int>& perm, int num_threads = 1) {
+  assert(transpose_detail::IsPermutation(perm, shape.size()));
+
+  // drop size-1 dims
+  std::vector<int> squeezed(shape.size(), -1);
+  std::vector<size_t> kept_shape;
+  for (size_t d = 0; d < shape.size(); d++) {
+    if (shape[d] == 1) continue;
+    squeezed[d] = static_cast<int>(kept_shape.size());
+    kept_shape.push_back(shape[d]);
+  }
+
+  // merge src dims that stay adjacent in dst into runs, kept in dst order
+  std::vector<int> run_start;  // leading src dim of each run
+  std::vector<size_t> run_size;
+  int last = -2;
+  for (size_t q = 0; q < perm.size(); q++) {
+    const int d = squeezed[perm[q]];
+    if (d < 0) continue;
+    if (d == last + 1) {
+      run_size.back() *= kept_shape[d];
+    } else {
+      run_start.push_back(d);
+      run_size.push_back(kept_shape[d]);
+    }
+    last = d;
+  }
+  const int nd = static_cast<int>(run_start.size());
+
+  size_t total = 1;
+  for (int q = 0; q < nd; q++) total *= run_size[q];
+  if (total == 0) return;
+  if (nd <= 1) {
+    std::memcpy(dst, src, total * sizeof(T));
+    return;
+  }
+
+  // new_perm[q] is the rank of run q in src order
+  std::vector<int> order(nd);
+  for (int q = 0; q < nd; q++) order[q] = q;
+  std::sort(order.begin(), order.end(),
+            [&](int x, int y) { return run_start[x] < run_start[y]; });
+  std::vector<int> new_perm(nd);
+  std::vector<size_t> src_shape(nd);
+  for (int d = 0; d < nd; d++) {
+    new_perm[order[d]] = d;
+    src_shape[d] = run_size[order[d]];
+  }
+
+  // strides of every src dim in src and in dst
+  std::vector<size_t> src_stride(nd);
+  std::vector<size_t> dst_stride(nd);
+  size_t stride = 1;
+  for (int d = nd - 1; d >= 0; d--) {
+    src_stride[d] = stride;
+    stride *= src_shape[d];
+  }
+  stride = 1;
+  for (int q = nd - 1; q >= 0; q--) {
+    dst_stride[new_perm[q]] = stride;
+    stride *= src_shape[new_perm[q]];
+  }
+
+  // the inner 2-d problem: src dim `row` becomes the innermost dst dim,
+  // the innermost src dim is contiguous and stays as columns
+  const int col = nd - 1;
+  const int row = new_perm[nd - 1];
+  const bool copy_rows = row == col;
+
+  std::vector<int> outer_dims;
+  size_t num_outer = 1;
+  for (int d = 0; d < nd; d++) {
+    if (d == col || d == row) continue;
+    outer_dims.push_back(d);
+    num_outer *= src_shape[d];
+  }
+
+  const int outer_threads = std::min<size_t>(std::max(num_threads, 1),
+                                             num_outer);
+  const int inner_threads = std::max(num_threads, 1) / outer_threads;
+  ParallelFor(num_outer, 1, outer_threads, [&](size_t begin, size_t end) {
+    for (size_t o = begin; o < end; o++) {
+      size_t src_offset = 0;
+      size_t dst_offset = 0;
+      for (size_t k = outer_dims.size(), rest = o; k-- > 0;) {
+        const int d = outer_dims[k];
+        const size_t index = rest % src_shape[d];
+        rest /= src_shape[d];
+        src_offset += index * src_stride[d];
+        dst_offset += index * dst_stride[d];
+      }
+
+      if (copy_rows) {
+        std::memcpy(dst + dst_offset, src + src_offset,
+                    src_shape[col] * sizeof(T));
+      } else {
+        Transpose(src_shape[row], src_shape[col], src + src_offset,
+                  src_stride[row], dst + dst_offset, dst_stride[col],
+                  inner_threads);
+      }
+    }
+  });
+}
+}  // namespace utils
+
+#endif  // UTILS_TRANSPOSE_H